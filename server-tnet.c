@@ -10,6 +10,7 @@
 #include "certificates.h"
 #include "commands.h"
 #include "errors_events.h"
+#include "esp_timer.h"
 #include "FreeRTOS_Support.h"
 #include "socketsX.h"
 #include "syslog.h"
@@ -18,6 +19,8 @@
 #include "stdioX.h"
 
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 /* Documentation links
  * Obsolete:
@@ -44,13 +47,94 @@
 #define tnetMS_READ_WRITE			70
 #define tnetMS_AUTHEN				30000	// per prompt (User:/Pswd:), so 60s worst case
 
+#ifdef CONFIG_LWIP_TCP_MSS
+	#define tnetTX_MSS				CONFIG_LWIP_TCP_MSS
+#else
+	#define tnetTX_MSS				1436
+#endif
+#define tnetTX_BULK					256		// bytes output by one command before switching to bulk mode
+#define tnetWORD_ONES				0x01010101UL	// NVT encoder, byte lanes of a 32 bit word
+#define tnetWORD_HIGH				0x80808080UL
+#define tnetBENCH_SIZE				1024
+#define tnetBENCH_LOOPS				500
+#define tnetCACHE_OPTS				16		// option answers remembered per client
+#define tnetCACHE_FP				8		// client option requests in the fingerprint
+#define tnetMS_CACHE				2000	// primed answers verified/learned within this window
+#define tnetFNV_BASIS				2166136261UL
+#define tnetFNV_PRIME				16777619UL
+#define tnetMS_NEGOTIATE			1000	// max wait for client to answer a server initiated option
+#define tnetBIN_CHUNK				2048	// file read size for binary transfers
+#define tnetRX_HOLD					256		// data received while negotiating, kept for the RUNNING loop
+
+/* Batch (pipelined) commands, for automation clients:
+ *	request:	SOH <id> SP <command> EOL		id in decimal 0..65535, any number back to back
+ *				EOL is CR, LF, CR LF or CR NUL, the LF/NUL following a CR belongs to the line
+ *	response:	SOH id[2] status[1] len[2] data[len]	id & len big endian, IAC doubled on the wire
+ * Commands are run in the order received, output longer than tnetBATCH_BUF is returned in
+ * several frames with status tnetBATCH_MORE, the last frame carries the command result.
+ * Frames are binary so are only sent in TRANSMIT-BINARY mode (RFC856). The client opens a batch
+ * with IAC DO BINARY ahead of its lines, the server answers WILL and stays in binary until the
+ * client sends IAC DONT BINARY. Without that the server asks (WILL) on the first line and drops
+ * binary again when idle, which only works for short batches: lines pipelined behind the first
+ * are held while waiting for the answer, and only up to tnetRX_HOLD bytes. If binary cannot be
+ * agreed the line is not run and "?Batch <id> needs BINARY" returned as plain text instead. */
+#define tnetBATCH_SOH				0x01
+#define tnetBATCH_MORE				0x7F
+#define tnetBATCH_HDR				6
+#define tnetBATCH_BUF				(tnetTX_MSS - tnetBATCH_HDR)
+#define tnetBATCH_CMD				64
+
+// ###################################### BUILD : CONFIG definitions ###############################
+
+#ifndef	tnetRATE_SESSION
+	#define	tnetRATE_SESSION		0		// bytes/sec per session, 0 = unlimited
+#endif
+
+#ifndef	tnetRATE_SERVER
+	#define	tnetRATE_SERVER			0		// bytes/sec all sessions combined, 0 = unlimited
+#endif
+
+#ifndef	tnetTX_QUEUE
+	#define	tnetTX_QUEUE			(tnetTX_MSS * 3)	// output queued while paced, beyond this commands wait
+#endif
+_Static_assert(tnetTX_QUEUE >= tnetTX_MSS, "tnetTX_QUEUE must hold a full segment, bulk mode only sends full ones");
+_Static_assert(tnetTX_QUEUE <= UINT16_MAX, "tnetTX_QUEUE exceeds u16_t txout/txlen");
+
+#ifndef	tnetCACHE_SIZE
+	#define	tnetCACHE_SIZE			4		// clients remembered for fast reconnect
+#endif
+
 // ########################################## structures ###########################################
 
 typedef struct opts_t { // used to decode known/supported options
-	u8_t val[10];
-	const char *name[10];
+	u8_t val[11];
+	const char *name[11];
 } opts_t;
 
+typedef struct tnet_tb_t {	// token bucket, transmit rate limit
+	u32_t Rate;											// bytes/sec, 0 = unlimited
+	u32_t Burst;										// bucket depth
+	u32_t Tokens;
+	u32_t Tick;											// last refill
+} tnet_tb_t;
+
+/* Negotiated state of a recent client, keyed by peer address & fingerprint. The fingerprint is
+ * an order independent hash of the DISTINCT requests the client initiated itself, ie on options
+ * other than those the server baseline opens (which the client only answers). On reconnect the
+ * answers are sent up front and the OPTIONS phase skipped. For tnetMS_CACHE requests are then
+ * checked against the cached answers; a request needing another answer, or a fingerprint that
+ * does not match, evicts the entry and the rest of the session is learned to replace it. */
+enum { tnetCACHE_REQ, tnetCACHE_OPT, tnetCACHE_RSP };	// Answer[] triple, REQ = 0 if baseline
+typedef struct tnet_cache_t {
+	u32_t Addr;											// peer IPv4 address, 0 = unused
+	u32_t Hash;											// client fingerprint
+	u32_t Used;											// tick last used, LRU
+	u16_t ColX, RowY;
+	u8_t Count;											// client requests in Hash
+	u8_t Len;											// answers in Answer[]
+	u8_t Answer[tnetCACHE_OPTS][3];						// request, option & response, in order
+} tnet_cache_t;
+
 typedef struct tnet_con_t {
 	netx_t sCtx;
 	u8_t optdata[35];
@@ -64,6 +148,30 @@ typedef struct tnet_con_t {
 	u8_t authbuf[35];
 	u8_t authlen;
 	u32_t authDL;										// tick deadline for the whole exchange
+	/* Transmit queue. lwIP has no TCP_CORK so the cork is done here: once a command has produced
+	 * more than tnetTX_BULK bytes output is queued and sent in MSS sized chunks, the remainder
+	 * flushed when the command completes. TCP_NODELAY stays set throughout so the final partial
+	 * segment is not held back waiting for a (delayed) ACK. Output the token buckets do not allow
+	 * yet stays queued, [txout..txlen), and is sent from the idle loop as tokens become available. */
+	u8_t txbuf[tnetTX_QUEUE];
+	u16_t txout, txlen;
+	tnet_tb_t sTB;										// session rate limit
+	u32_t txburst;										// bytes output by the current command
+	bool txcr;											// NVT text ended with CR, NUL or LF to follow
+	tnet_cache_t * psCache;								// entry primed from or stored for this client
+	u32_t cacheDL;										// tick deadline, verify (primed) or learn (miss)
+	u32_t fphash;										// client fingerprint being built
+	u8_t fpcount;
+	u8_t fpseen[tnetOPT_MAX_VAL];						// requests (bit per WILL...DONT) in fphash
+	u8_t anslen;										// answers being learned
+	u8_t answer[tnetCACHE_OPTS][3];
+	u8_t rxhold[tnetRX_HOLD];							// data bytes (already parsed) received in xTelnetSetBinary()
+	u16_t rxhout, rxhlen;
+	u8_t batbuf[tnetBATCH_BUF];							// batch command output, framed when full/done
+	u16_t batlen;
+	u16_t batid;
+	u8_t cmdbuf[tnetBATCH_CMD];							// batch command line being collected
+	u8_t cmdlen;
 	union { // internal flags
 		struct __attribute__((packed)) {
 			u8_t TxNow:1;
@@ -73,9 +181,19 @@ typedef struct tnet_con_t {
             u8_t track:1;
             u8_t apswd:1;							// 0 = collecting username, 1 = password
             u8_t aok:1;								// username matched
-            u8_t spare:1;
+            u8_t Bulk:1;							// 0 = interactive, 1 = bulk (buffered) output
+            u8_t BinReq:1;							// WILL/WONT BINARY sent, awaiting DO/DONT
+            u8_t BinTx:1;							// client agreed, transmitting binary
+            u8_t BinCli:1;							// binary requested (DO) by the client, it ends it
+            u8_t Batch:1;							// collecting a batch command line
+            u8_t BatRun:1;							// executing a batch command, output framed
+            u8_t TxGA:1;							// GA to follow once the queue is empty
+            u8_t Primed:1;							// answers sent from cache, OPTIONS skipped
+            u8_t Learn:1;							// record answers (OPTIONS phase or after a miss)
+            u8_t Relearn:1;							// cache miss, store what was learned at the end
+            u8_t BatCR:1;							// batch line ended on CR, drop a following LF/NUL
 		};
-		u8_t flag;
+		u32_t flag;
 	};
 	u16_t ColX, RowY;
 } tnet_con_t;
@@ -87,16 +205,17 @@ const char *const codename[4] = {"WILL", "WONT", "DO", "DONT"};
 static const u8_t cAuthBS[3] = { CHR_BS, CHR_SPACE, CHR_BS };	// erase one echoed character
 
 opts_t options = {
-	.val[0] = tnetOPT_ECHO,		.name[0] = "Echo",
-	.val[1] = tnetOPT_SGA,		.name[1] = "SGA",
-	.val[2] = tnetOPT_TTYPE,	.name[2] = "TType",
-	.val[3] = tnetOPT_NAWS,		.name[3] = "NaWS",
-	.val[4] = tnetOPT_TSPEED,	.name[4] = "TSPeed",
-	.val[5] = tnetOPT_LMODE,	.name[5] = "LMode",
-	.val[6] = tnetOPT_OLD_ENV,	.name[6] = "Oenv",
-	.val[7] = tnetOPT_NEW_ENV,	.name[7] = "Nenv",
-	.val[8] = tnetOPT_STRT_TLS,	.name[8] = "STLS",
-	.val[9] = tnetOPT_UNDEF,	.name[9] = "Oxx",
+	.val[0] = tnetOPT_BINARY,	.name[0] = "Bin",
+	.val[1] = tnetOPT_ECHO,		.name[1] = "Echo",
+	.val[2] = tnetOPT_SGA,		.name[2] = "SGA",
+	.val[3] = tnetOPT_TTYPE,	.name[3] = "TType",
+	.val[4] = tnetOPT_NAWS,		.name[4] = "NaWS",
+	.val[5] = tnetOPT_TSPEED,	.name[5] = "TSPeed",
+	.val[6] = tnetOPT_LMODE,	.name[6] = "LMode",
+	.val[7] = tnetOPT_OLD_ENV,	.name[7] = "Oenv",
+	.val[8] = tnetOPT_NEW_ENV,	.name[8] = "Nenv",
+	.val[9] = tnetOPT_STRT_TLS,	.name[9] = "STLS",
+	.val[10] = tnetOPT_UNDEF,	.name[10] = "Oxx",
 };
 
 // ####################################### Public Variables ########################################
@@ -109,9 +228,16 @@ static netx_t sServTNetCtx = {0};
 static tnet_con_t sTerm = {0};
 static u8_t State, SubState;
 static param_tnet_t * psParam;
+static tnet_tb_t sServTB = {0};							// server (all sessions) rate limit
+static u32_t SessRate = tnetRATE_SESSION, ServRate = tnetRATE_SERVER;
+static tnet_cache_t sCache[tnetCACHE_SIZE] = {0};
+static u32_t CacheHit, CacheMiss;
 
 // ####################################### private functions #######################################
 
+static int xTelnetFlush(void);
+static int xTelnetEndText(void);
+
 static void vTelnetUpdateStats(void) {
 	if (sServTNetCtx.maxTx < sTerm.sCtx.maxTx)
 		sServTNetCtx.maxTx = sTerm.sCtx.maxTx;
@@ -119,7 +245,56 @@ static void vTelnetUpdateStats(void) {
 		sServTNetCtx.maxRx = sTerm.sCtx.maxRx;
 }
 
+/**
+ * @brief	most recently used cache entry for a peer address
+ * @return	pointer to the entry or NULL if none
+ */
+static tnet_cache_t * psTelnetCacheFind(u32_t Addr) {
+	tnet_cache_t * psC = NULL;
+	for (int idx = 0; idx < tnetCACHE_SIZE; ++idx) {
+		if (sCache[idx].Addr == Addr && (psC == NULL || (i32_t) (sCache[idx].Used - psC->Used) > 0))
+			psC = &sCache[idx];
+	}
+	return psC;
+}
+
+/**
+ * @brief	remember the answers, fingerprint & window size learned for this client
+ * @note	replaces the entry for the same client, else an unused entry, else the least recently used
+ */
+static void vTelnetCacheStore(void) {
+	u32_t Addr = sTerm.sCtx.sa_in.sin_addr.s_addr;
+	tnet_cache_t * psC = &sCache[0];
+	for (int idx = 0; idx < tnetCACHE_SIZE; ++idx) {
+		tnet_cache_t * psT = &sCache[idx];
+		if (psT->Addr == Addr && psT->Hash == sTerm.fphash) {
+			psC = psT;
+			break;
+		}
+		if (psC->Addr && (psT->Addr == 0 || (i32_t) (psT->Used - psC->Used) < 0))
+			psC = psT;
+	}
+	psC->Addr = Addr;
+	psC->Hash = sTerm.fphash;
+	psC->Count = sTerm.fpcount;
+	psC->Used = xTaskGetTickCount();
+	psC->ColX = sTerm.ColX;
+	psC->RowY = sTerm.RowY;
+	psC->Len = sTerm.anslen;
+	memcpy(psC->Answer, sTerm.answer, sizeof(psC->Answer));
+	sTerm.psCache = psC;
+}
+
 static void vTelnetDeInit(void) {
+	if (sTerm.Relearn) {								// session after a cache miss, replace the entry
+		sTerm.Relearn = sTerm.Learn = 0;
+		vTelnetCacheStore();
+	}
+	if (sTerm.psCache) {								// keep latest window size for the next connect
+		sTerm.psCache->ColX = sTerm.ColX;
+		sTerm.psCache->RowY = sTerm.RowY;
+		sTerm.psCache = NULL;
+	}
 	if (sTerm.sCtx.sd > 0)
 		xNetClose(&sTerm.sCtx);
 	halEventUpdateStatus(flagTNET_CLNT, 0);
@@ -143,11 +318,11 @@ static const char *xTelnetFindName(u8_t opt) {
 
 /**
  * @brief		store the value (WILL/WONT/DO/DONT) for a specific option.
- * @param[in]	option - ECHO ... START_TLS
+ * @param[in]	option - BINARY ... START_TLS
  * @param[in]	code - WILL / WONT / DO / DONT
  */
 static void xTelnetSetOption(u8_t opt, u8_t val) {
-	IF_myASSERT(debugPARAM, INRANGE(tnetOPT_ECHO, opt, tnetOPT_STRT_TLS) && INRANGE(tnetWILL, val, tnetDONT));
+	IF_myASSERT(debugPARAM, INRANGE(tnetOPT_BINARY, opt, tnetOPT_STRT_TLS) && INRANGE(tnetWILL, val, tnetDONT));
 	val -= tnetWILL;
 	IF_PX(debugSETOPT, "[set o=%s v=%s] ", xTelnetFindName(opt), codename[val]);
 	u8_t Xidx = opt / 4;	   // 2 bits/value, 4 options/byte
@@ -158,11 +333,11 @@ static void xTelnetSetOption(u8_t opt, u8_t val) {
 
 /**
  * xTelnetGetOption() - retrieve the value (WILL/WONT/DO/DONT) for a specific option.
- * @param option	ECHO ... START_TLS
+ * @param option	BINARY ... START_TLS
  * @return code		WILL / WONT / DO / DONT
  */
 static u8_t xTelnetGetOption(u8_t opt) {
-	IF_myASSERT(debugPARAM, INRANGE(tnetOPT_ECHO, opt, tnetOPT_STRT_TLS));
+	IF_myASSERT(debugPARAM, INRANGE(tnetOPT_BINARY, opt, tnetOPT_STRT_TLS));
 	u8_t val = (sTerm.options[opt / 4] >> ((opt % 4) * 2)) & 0x03;
 	IF_PX(debugGETOPT, "[get o=%s v=%s] ", xTelnetFindName(opt), codename[val]);
 	return val;
@@ -203,6 +378,170 @@ static void vTelnetSendOption(u8_t opt, u8_t cmd) {
 	}
 }
 
+/**
+ * @brief	record an answer while learning, a later answer to the same request replaces the earlier
+ * @param	req - request received, 0 if sent unsolicited (baseline)
+ */
+static void vTelnetCacheRecord(u8_t req, u8_t opt, u8_t rsp) {
+	if (sTerm.Relearn && (i32_t) (xTaskGetTickCount() - sTerm.cacheDL) >= 0)
+		sTerm.Learn = 0;								// after a miss learn as long as a full session would
+	if (sTerm.Learn == 0)
+		return;
+	int idx = 0;
+	if (req) {											// baseline answers are kept in order, as sent
+		while (idx < sTerm.anslen && (sTerm.answer[idx][tnetCACHE_REQ] != req || sTerm.answer[idx][tnetCACHE_OPT] != opt))
+			++idx;
+	} else {
+		idx = sTerm.anslen;
+	}
+	if (idx == tnetCACHE_OPTS)
+		return;
+	sTerm.answer[idx][tnetCACHE_REQ] = req;
+	sTerm.answer[idx][tnetCACHE_OPT] = opt;
+	sTerm.answer[idx][tnetCACHE_RSP] = rsp;
+	if (idx == sTerm.anslen)
+		++sTerm.anslen;
+}
+
+static void vTelnetSendBaseline(u8_t opt, u8_t cmd) {
+	vTelnetSendOption(opt, cmd);
+	vTelnetCacheRecord(0, opt, cmd);
+}
+
+static int xTelnetSetBaseline(void) {
+	/*					Putty			MikroTik
+	 *	WONT	DONT	no echo			local echo
+	 *	WILL	DONT	no echo			no echo
+	 */
+	int iRV = xTelnetGetOption(tnetOPT_ECHO);
+	if (iRV == valWILL || iRV == valDONT) {
+		vTelnetSendBaseline(tnetOPT_ECHO, tnetDONT);
+		vTelnetSendBaseline(tnetOPT_ECHO, tnetWILL);
+	}
+	/*					Putty			MikroTik
+	 *	WONT	DONT	working			not working
+	 *	WILL	DONT	not working		not working
+	 *	WONT	DO		not working		not working
+	 *	WILL	DO		not working		not working
+	 */
+	iRV = xTelnetGetOption(tnetOPT_SGA);
+	if (iRV == valWONT || iRV == valDONT) {
+		vTelnetSendBaseline(tnetOPT_SGA, tnetDO);
+		vTelnetSendBaseline(tnetOPT_SGA, tnetWILL);
+	}
+	/*					Putty			MikroTik		Serial
+	 *	WONT	DONT	
+	 *	WILL	DONT	
+	 *	WONT	DO		
+	 *	WILL	DO		
+	 */
+	iRV = xTelnetGetOption(tnetOPT_NAWS);
+	if (iRV == valWONT || iRV == valDONT) {
+		vTelnetSendBaseline(tnetOPT_NAWS, tnetDO);
+		vTelnetSendBaseline(tnetOPT_NAWS, tnetWILL);
+	}
+	return erSUCCESS;
+}
+
+/**
+ * @brief	if the client is known send its answers up front, in a single segment
+ * @return	1 if primed, 0 if not known, erFAILURE if the send failed (connection closed)
+ */
+static int xTelnetCachePrime(void) {
+	tnet_cache_t * psC = psTelnetCacheFind(sTerm.sCtx.sa_in.sin_addr.s_addr);
+	if (psC == NULL)
+		return 0;
+	u8_t Buf[tnetCACHE_OPTS * 3];
+	u8_t Base[tnetOPT_MAX_VAL] = {0};					// options opened by the baseline
+	for (int idx = 0; idx < psC->Len; ++idx) {
+		u8_t opt = psC->Answer[idx][tnetCACHE_OPT];
+		if (psC->Answer[idx][tnetCACHE_REQ] == 0 && opt < tnetOPT_MAX_VAL)
+			Base[opt] = 1;
+	}
+	int Len = 0;
+	for (int idx = 0; idx < psC->Len; ++idx) {
+		u8_t opt = psC->Answer[idx][tnetCACHE_OPT];
+		if (psC->Answer[idx][tnetCACHE_REQ] && opt < tnetOPT_MAX_VAL && Base[opt])
+			continue;									// client reply to the baseline, answered when it arrives
+		Buf[Len++] = tnetIAC;
+		Buf[Len++] = psC->Answer[idx][tnetCACHE_RSP];
+		Buf[Len++] = opt;
+	}
+	if (xNetSend(&sTerm.sCtx, Buf, Len) != Len) {
+		vTelnetDeInit();
+		return erFAILURE;
+	}
+	for (int idx = 0; idx < psC->Len; ++idx)
+		xTelnetSetOption(psC->Answer[idx][tnetCACHE_OPT], psC->Answer[idx][tnetCACHE_RSP]);
+	vTelnetUpdateStats();
+	sTerm.ColX = psC->ColX;
+	sTerm.RowY = psC->RowY;
+	psC->Used = xTaskGetTickCount();
+	sTerm.psCache = psC;
+	sTerm.Primed = 1;
+	sTerm.Learn = 0;
+	sTerm.cacheDL = xTaskGetTickCount() + pdMS_TO_TICKS(tnetMS_CACHE);
+	++CacheHit;
+	return 1;
+}
+
+/**
+ * @brief	cached answer to a specific request
+ * @return	response or 0 if the request was not seen when the entry was learned
+ */
+static u8_t xTelnetCacheAnswer(u8_t req, u8_t opt) {
+	for (int idx = 0; idx < sTerm.psCache->Len; ++idx) {
+		if (sTerm.psCache->Answer[idx][tnetCACHE_REQ] == req && sTerm.psCache->Answer[idx][tnetCACHE_OPT] == opt)
+			return sTerm.psCache->Answer[idx][tnetCACHE_RSP];
+	}
+	return 0;
+}
+
+/**
+ * @brief	client does not match its cached state, evict it and learn the rest of this session
+ * @note	the up front answers stand, negotiation simply continues in band (RFC854 allows it
+ *			at any time) so neither the option state nor the baseline is touched
+ */
+static void vTelnetCacheMiss(void) {
+	IF_PX(debugTRACK && psParam->track, "[TNET] cache miss" strNL);
+	memcpy(sTerm.answer, sTerm.psCache->Answer, sizeof(sTerm.answer));	// seed with what was sent
+	sTerm.anslen = sTerm.psCache->Len;
+	sTerm.psCache->Addr = 0;
+	sTerm.psCache = NULL;
+	sTerm.Primed = 0;
+	sTerm.Learn = sTerm.Relearn = 1;
+	sTerm.cacheDL = xTaskGetTickCount() + pdMS_TO_TICKS(tnetMS_CACHE);
+	++CacheMiss;
+}
+
+/**
+ * @brief	add a client initiated request to its fingerprint, verify it once complete if primed
+ */
+static void vTelnetFingerprint(u8_t cmd, u8_t opt) {
+	if (sTerm.Primed && (i32_t) (xTaskGetTickCount() - sTerm.cacheDL) >= 0)
+		sTerm.Primed = 0;								// not contradicted in time, accepted
+	bool bWindow = (State == tnetSTATE_OPTIONS) || sTerm.Primed ||
+					(sTerm.Relearn && (i32_t) (xTaskGetTickCount() - sTerm.cacheDL) < 0);
+	if (bWindow == 0 || sTerm.fpcount >= tnetCACHE_FP)
+		return;
+	if (opt == tnetOPT_BINARY || opt == tnetOPT_ECHO || opt == tnetOPT_SGA || opt == tnetOPT_NAWS)
+		return;											// baseline options, client only answers
+	if (opt < tnetOPT_MAX_VAL) {						// count each request once, order independent
+		u8_t Mask = 1 << (cmd - tnetWILL);
+		if (sTerm.fpseen[opt] & Mask)
+			return;
+		sTerm.fpseen[opt] |= Mask;
+	}
+	sTerm.fphash += ((((tnetFNV_BASIS ^ cmd) * tnetFNV_PRIME) ^ opt) * tnetFNV_PRIME);
+	++sTerm.fpcount;
+	if (sTerm.Primed && sTerm.fpcount == sTerm.psCache->Count) {
+		if (sTerm.fphash == sTerm.psCache->Hash)
+			sTerm.Primed = 0;							// verified, negotiate normally from here
+		else
+			vTelnetCacheMiss();
+	}
+}
+
 /**
  * xTelnetNegotiate()
  * @param code
@@ -225,22 +564,54 @@ static void vTelnetSendOption(u8_t opt, u8_t cmd) {
  */
 static void vTelnetNegotiate(u8_t opt, u8_t cmd) {
 	IF_PX(debugTRACK && psParam->track, "[neg o=%s req=%s] ", xTelnetFindName(opt), codename[cmd - tnetWILL]);
+	u8_t rsp;
 	switch (opt) {
+	case tnetOPT_BINARY: {          // Server transmits binary when asked or it asks, never receives binary
+		if (cmd == tnetWILL || cmd == tnetWONT) {
+			vTelnetSendOption(opt, tnetDONT);
+		} else if (sTerm.BinReq) {					// answer to our WILL/WONT, must NOT be acknowledged
+			sTerm.BinReq = 0;
+			sTerm.BinTx = (cmd == tnetDO) ? 1 : 0;
+			xTelnetSetOption(opt, sTerm.BinTx ? tnetWILL : tnetWONT);
+		} else if (cmd == tnetDONT && sTerm.BinTx) {	// client ends binary, queued data goes as binary
+			if (xTelnetFlush() == erSUCCESS) {
+				sTerm.BinTx = sTerm.BinCli = 0;
+				vTelnetSendOption(opt, tnetWONT);
+			}
+		} else if (cmd == tnetDO && sTerm.BinTx == 0) {	// client opens a batch, queued text goes first
+			if (xTelnetEndText() == erSUCCESS && xTelnetFlush() == erSUCCESS) {
+				sTerm.BinTx = sTerm.BinCli = 1;
+				vTelnetSendOption(opt, tnetWILL);
+			}
+		}											// else mode already in effect, NOT acknowledged (RFC854)
+		return;										// never part of the cached answers
+	}
 	case tnetOPT_ECHO: {            // Client must not (DONT) and server WILL
-		vTelnetSendOption(opt, (cmd == tnetWILL || cmd == tnetWONT) ? tnetDONT : tnetWILL);
+		rsp = (cmd == tnetWILL || cmd == tnetWONT) ? tnetDONT : tnetWILL;
 		break;
     }
 	case tnetOPT_SGA: {             // Client must (DO) and server WILL
-		vTelnetSendOption(opt, (cmd == tnetWILL || cmd == tnetWONT) ? tnetDO : tnetWILL);
+		rsp = (cmd == tnetWILL || cmd == tnetWONT) ? tnetDO : tnetWILL;
 		break;
     }
 	case tnetOPT_NAWS: {            // can have functionality
-		vTelnetSendOption(opt, (cmd == tnetWILL || cmd == tnetWONT) ? tnetDO : tnetWILL);
+		rsp = (cmd == tnetWILL || cmd == tnetWONT) ? tnetDO : tnetWILL;
 		break;
     }
 	default: // Client WILL/WONT, but Server DONT  <ALT>  Client DO/DONT but Server WONT
-		vTelnetSendOption(opt, cmd == tnetWILL || cmd == tnetWONT ? tnetDONT : tnetWONT);
+		rsp = cmd == tnetWILL || cmd == tnetWONT ? tnetDONT : tnetWONT;
 	}
+	if (sTerm.Primed && (i32_t) (xTaskGetTickCount() - sTerm.cacheDL) >= 0)
+		sTerm.Primed = 0;							// verification window over
+	if (sTerm.Primed) {
+		if (xTelnetCacheAnswer(cmd, opt) != rsp) {
+			vTelnetCacheMiss();						// client disagrees, learn from here on
+		} else if ((rsp == tnetWILL || rsp == tnetDO) && xTelnetGetOption(opt) == (rsp - tnetWILL)) {
+			return;									// confirms a mode in effect, do NOT acknowledge again
+		}											// refusals crossed the request on the wire, resend
+	}
+	vTelnetSendOption(opt, rsp);
+	vTelnetCacheRecord(cmd, opt, rsp);
 }
 
 static void vTelnetUpdateOption(void) {
@@ -289,7 +660,8 @@ static int xTelnetParseChar(int cChr) {
 		break;
 	}
 	case tnetSUBST_OPT: {
-		vTelnetNegotiate(cChr, sTerm.code);
+		vTelnetNegotiate(cChr, sTerm.code);			// checked against the cache before verifying
+		vTelnetFingerprint(sTerm.code, cChr);
 		SubState = tnetSUBST_CHECK;
 		break;
 	}
@@ -318,50 +690,383 @@ static int xTelnetParseChar(int cChr) {
 	return erSUCCESS;
 }
 
-static int xTelnetSetBaseline(void) {
-	/*					Putty			MikroTik
-	 *	WONT	DONT	no echo			local echo
-	 *	WILL	DONT	no echo			no echo
-	 */
-	int iRV = xTelnetGetOption(tnetOPT_ECHO);
-	if (iRV == valWILL || iRV == valDONT) {
-		vTelnetSendOption(tnetOPT_ECHO, tnetDONT);
-		vTelnetSendOption(tnetOPT_ECHO, tnetWILL);
+/**
+ * @brief	(re)configure a token bucket
+ * @param	Rate - bytes/sec, 0 = unlimited
+ */
+static void vTelnetBucketInit(tnet_tb_t * psTB, u32_t Rate) {
+	psTB->Rate = Rate;
+	psTB->Burst = (Rate / 4 > tnetTX_MSS) ? Rate / 4 : tnetTX_MSS;	// 250mS worth, at least 1 segment
+	psTB->Tokens = psTB->Burst;
+	psTB->Tick = xTaskGetTickCount();
+}
+
+static void vTelnetBucketFill(tnet_tb_t * psTB) {
+	u32_t Now = xTaskGetTickCount();
+	u64_t Add = (u64_t) psTB->Rate * (Now - psTB->Tick) / configTICK_RATE_HZ;
+	if (Add == 0)
+		return;											// leave Tick, partial tokens accumulate
+	psTB->Tick = Now;
+	psTB->Tokens = (psTB->Tokens + Add > psTB->Burst) ? psTB->Burst : psTB->Tokens + Add;
+}
+
+/**
+ * @brief	check if session AND server rate limits allow Size bytes to be sent now
+ */
+static bool bTelnetTokens(size_t Size) {
+	tnet_tb_t * psTB[2] = { &sTerm.sTB, &sServTB };
+	for (int idx = 0; idx < 2; ++idx) {
+		if (psTB[idx]->Rate == 0)
+			continue;
+		vTelnetBucketFill(psTB[idx]);
+		if (psTB[idx]->Tokens < Size)
+			return 0;
 	}
-	/*					Putty			MikroTik
-	 *	WONT	DONT	working			not working
-	 *	WILL	DONT	not working		not working
-	 *	WONT	DO		not working		not working
-	 *	WILL	DO		not working		not working
-	 */
-	iRV = xTelnetGetOption(tnetOPT_SGA);
-	if (iRV == valWONT || iRV == valDONT) {
-		vTelnetSendOption(tnetOPT_SGA, tnetDO);
-		vTelnetSendOption(tnetOPT_SGA, tnetWILL);
+	return 1;
+}
+
+static void vTelnetTokensUsed(size_t Size) {
+	if (sTerm.sTB.Rate)
+		sTerm.sTB.Tokens -= (Size < sTerm.sTB.Tokens) ? Size : sTerm.sTB.Tokens;
+	if (sServTB.Rate)
+		sServTB.Tokens -= (Size < sServTB.Tokens) ? Size : sServTB.Tokens;
+}
+
+/**
+ * @brief	send queued output, MSS sized chunks, as far as the rate limit(s) allow
+ * @param	bPart - 0 = full segments only, 1 = include a final partial segment
+ * @return	erSUCCESS or (-) error code
+ */
+static int xTelnetDrain(bool bPart) {
+	while (sTerm.txout < sTerm.txlen) {
+		size_t Len = sTerm.txlen - sTerm.txout;
+		if (Len > tnetTX_MSS)
+			Len = tnetTX_MSS;
+		else if (Len < tnetTX_MSS && bPart == 0)
+			break;										// keep packing
+		if (bTelnetTokens(Len) == 0)
+			break;										// paced, rest goes when tokens available
+		int iRV = xNetSend(&sTerm.sCtx, &sTerm.txbuf[sTerm.txout], Len);
+		if (iRV < 0) {
+			sTerm.txout = sTerm.txlen = 0;
+			State = tnetSTATE_DEINIT;
+			return iRV;
+		}
+		vTelnetTokensUsed(iRV);
+		sTerm.txout += iRV;
 	}
-	/*					Putty			MikroTik		Serial
-	 *	WONT	DONT	
-	 *	WILL	DONT	
-	 *	WONT	DO		
-	 *	WILL	DO		
-	 */
-	iRV = xTelnetGetOption(tnetOPT_NAWS);
-	if (iRV == valWONT || iRV == valDONT) {
-		vTelnetSendOption(tnetOPT_NAWS, tnetDO);
-		vTelnetSendOption(tnetOPT_NAWS, tnetWILL);
+	if (sTerm.txout == sTerm.txlen) {
+		sTerm.txout = sTerm.txlen = 0;
+		if (sTerm.TxGA) {
+			sTerm.TxGA = 0;
+			return xTelnetHandleSGA();					// once per burst, not per segment
+		}
 	}
 	return erSUCCESS;
 }
 
+/**
+ * @brief	send ALL queued output, waiting for tokens if paced
+ * @return	erSUCCESS or (-) error code
+ */
+static int xTelnetFlush(void) {
+	int iRV;
+	while ((iRV = xTelnetDrain(1)) == erSUCCESS && sTerm.txlen)
+		vTaskDelay(1);
+	return iRV;
+}
+
+/**
+ * @brief	find the first byte that needs NVT encoding, 4 bytes at a time once word aligned
+ * @param	bText - 0 = binary, IAC only, 1 = text, also bare CR and bare LF
+ * @return	pointer to the byte or pE if none
+ * @note	a CR at pE - 1 is returned since its LF (if any) is not yet known
+ */
+static const u8_t * pTelnetScan(const u8_t * pS, const u8_t * pE, bool bText) {
+	while (pS < pE) {
+		if (((uintptr_t) pS & 3) == 0 && (pE - pS) >= 4) {
+			u32_t W;
+			memcpy(&W, pS, sizeof(W));						// aligned, single load
+			u32_t Hit = (~W - tnetWORD_ONES) & W & tnetWORD_HIGH;	// any byte == 0xFF
+			if (bText)
+				Hit |= (W - (tnetWORD_ONES * 0x0E)) & ~W & tnetWORD_HIGH;	// any byte < 0x0E (CR/LF/...)
+			if (Hit == 0) {
+				pS += 4;
+				continue;
+			}
+		}
+		/* byte at a time, unaligned head/tail or a word with a candidate (TAB, BS etc are clean) */
+		if (*pS == tnetIAC)
+			return pS;
+		if (bText && *pS == CHR_CR) {
+			if ((pS + 1) == pE || pS[1] != CHR_LF)
+				return pS;
+			pS += 2;									// CR LF is already NVT
+			continue;
+		}
+		if (bText && *pS == CHR_LF)
+			return pS;
+		++pS;
+	}
+	return pE;
+}
+
+/**
+ * @brief	NVT encode (RFC854) in a single pass: IAC -> IAC IAC and, for text, bare CR -> CR NUL
+ *			and bare LF -> CR LF. Clean runs are copied as a block.
+ * @param	pDst - destination buffer, sDst its size
+ * @param	pSrc - source buffer, *psSrc its size on entry and the number of bytes consumed on exit
+ * @param	bText - 0 = binary (IAC only), 1 = text
+ * @param	pbCR - CR at the end of the previous call, NUL or LF still to be decided (text only,
+ *			resolve with xTelnetEndText() before switching to binary)
+ * @return	number of bytes written to pDst
+ */
+static size_t xTelnetEncode(u8_t * pDst, size_t sDst, const u8_t * pSrc, size_t * psSrc, bool bText, bool * pbCR) {
+	const u8_t * pS = pSrc, * pE = pSrc + *psSrc;
+	u8_t * pD = pDst, * pDE = pDst + sDst;
+	while (pS < pE && pD < pDE) {
+		if (bText && *pbCR) {							// previous text byte output was a CR
+			*pbCR = 0;
+			*pD++ = (*pS == CHR_LF) ? *pS++ : CHR_NUL;
+			continue;
+		}
+		size_t Len = pE - pS;
+		if (Len > (size_t) (pDE - pD))
+			Len = pDE - pD;
+		const u8_t * pX = pTelnetScan(pS, pS + Len, bText);
+		memcpy(pD, pS, pX - pS);
+		pD += pX - pS;
+		pS = pX;
+		if (pS == pE || pD == pDE)
+			break;
+		if (*pS == CHR_CR && bText) {					// CR at the end of the scan window
+			*pD++ = *pS++;
+			*pbCR = 1;
+		} else if ((pDE - pD) < 2) {
+			break;										// IAC IAC or CR LF must not be split
+		} else {
+			*pD++ = (*pS == tnetIAC) ? tnetIAC : CHR_CR;
+			*pD++ = *pS++;
+		}
+	}
+	*psSrc = pS - pSrc;
+	return pD - pDst;
+}
+
+/**
+ * @brief	add output to the transmit queue, NVT encoded, sending what the mode & rate limit(s) allow
+ * @param	bText - 0 = binary, 1 = text
+ * @return	Size or (-) error code
+ * @note	only waits if the queue is full, i.e. the rate limit is well below the output rate
+ */
+static ssize_t xTelnetQueue(const void * pVoid, size_t Size, bool bText) {
+	const u8_t * pSrc = pVoid;
+	size_t Left = Size;
+	while (Left) {
+		size_t Room = sizeof(sTerm.txbuf) - sTerm.txlen;
+		if (sTerm.txout && Room < 2) {					// compact, make space at the end
+			sTerm.txlen -= sTerm.txout;
+			memmove(sTerm.txbuf, &sTerm.txbuf[sTerm.txout], sTerm.txlen);
+			sTerm.txout = 0;
+			Room = sizeof(sTerm.txbuf) - sTerm.txlen;
+		}
+		if (Room < 2) {
+			vTaskDelay(1);								// full, wait for tokens to drain it
+		} else {
+			size_t Used = Left;
+			sTerm.txlen += xTelnetEncode(&sTerm.txbuf[sTerm.txlen], Room, pSrc, &Used, bText, &sTerm.txcr);
+			pSrc += Used;
+			Left -= Used;
+		}
+		int iRV = xTelnetDrain(sTerm.Bulk == 0);
+		if (iRV < erSUCCESS)
+			return iRV;
+	}
+	return Size;
+}
+
+/**
+ * @brief	end NVT text, a pending bare CR gets its NUL before binary data or a mode change
+ * @return	erSUCCESS or (-) error code
+ */
+static int xTelnetEndText(void) {
+	static const u8_t cNUL = CHR_NUL;
+	if (sTerm.txcr == 0)
+		return erSUCCESS;
+	sTerm.txcr = 0;
+	ssize_t iRV = xTelnetQueue(&cNUL, 1, 0);
+	return (iRV < 0) ? iRV : erSUCCESS;
+}
+
+/**
+ * @brief	echo authentication input, behind any queued (paced) prompt
+ * @note	no GA, per character GA would be noise
+ */
+static ssize_t xTelnetEcho(const u8_t * pSrc, size_t Size) {
+	if (sTerm.txlen == 0 && sTerm.txcr == 0 && bTelnetTokens(Size)) {
+		int iRV = xNetSend(&sTerm.sCtx, (u8_t *) pSrc, Size);
+		if (iRV > 0)
+			vTelnetTokensUsed(iRV);
+		if (iRV < 0)
+			State = tnetSTATE_DEINIT;
+		return iRV;
+	}
+	return xTelnetQueue(pSrc, Size, 1);
+}
+
+/**
+ * @brief	end of command output, uncork and revert to interactive mode
+ * @note	whatever the rate limit(s) hold back is sent from the idle loop
+ */
+static void vTelnetEndBurst(void) {
+	if (sTerm.Bulk) {
+		sTerm.Bulk = 0;
+		sTerm.TxGA = 1;
+	}
+	sTerm.txburst = 0;
+	xTelnetDrain(1);
+}
+
+/**
+ * @brief	transmit output, direct if interactive & clean, else encoded via the queue
+ * @param	bText - 0 = binary, 1 = text
+ * @return	Size or (-) error code
+ */
+static ssize_t xTelnetSend(const void * pVoid, size_t Size, bool bText) {
+	sTerm.txburst += Size;
+	if (sTerm.Bulk == 0 && sTerm.txburst > tnetTX_BULK)
+		sTerm.Bulk = 1;									// sustained output, switch to bulk
+	if (sTerm.Bulk == 0 && sTerm.txlen == 0 && sTerm.txcr == 0 &&
+		pTelnetScan(pVoid, (const u8_t *) pVoid + Size, bText) == (const u8_t *) pVoid + Size &&
+		bTelnetTokens(Size)) {							// interactive, no encoding needed, send immediately
+		int iRV = xNetSend(&sTerm.sCtx, (u8_t *) pVoid, Size);
+		if (iRV > 0) {
+			vTelnetTokensUsed(iRV);
+			xTelnetHandleSGA();
+		}
+		if (iRV < 0)
+			State = tnetSTATE_DEINIT;
+		return iRV;
+	}
+	if (sTerm.Bulk == 0)
+		sTerm.TxGA = 1;									// interactive, but behind queued output
+	return xTelnetQueue(pVoid, Size, bText);
+}
+
 ssize_t xTelnetWrite(const void * pVoid, size_t Size) {
-	int iRV = xNetSend(&sTerm.sCtx, (u8_t *) pVoid, Size);
-	if (iRV > 0)
-		xTelnetHandleSGA();
-	if (iRV < 0)
-		State = tnetSTATE_DEINIT;
+	return xTelnetSend(pVoid, Size, sTerm.BinTx == 0);	// RFC856, no CR/LF translation in binary
+}
+
+/**
+ * @brief	write binary data, doubling every IAC (0xFF) but otherwise sent as is
+ * @return	number of (unescaped) bytes written or (-) error code
+ */
+static ssize_t xTelnetWriteBinary(const u8_t * pSrc, size_t Size) {
+	ssize_t iRV = xTelnetEndText();						// eg batch frame after "text\r"
+	if (iRV < erSUCCESS)
+		return iRV;
+	sTerm.Bulk = 1;										// binary transfers are bulk by definition
+	return xTelnetSend(pSrc, Size, 0);
+}
+
+/**
+ * @brief	negotiate TRANSMIT-BINARY on, waiting for the client to answer, or off
+ * @param	Flag - 1 = start binary, 0 = return to NVT
+ * @note	queued output is flushed first, from the idle loop only call it with the queue empty
+ * @return	erSUCCESS or erFAILURE if refused, not answered or connection failed
+ * @note	binary requested by the client (DO) is left on, the client ends it with DONT
+ * @note	data bytes received while waiting (eg pipelined batch lines) are held for the RUNNING
+ *			loop. If the hold buffer fills, reading stops: nothing is lost but the answer may be
+ *			missed and the negotiation fail.
+ */
+static int xTelnetSetBinary(int Flag) {
+	if (sTerm.BinTx == Flag || (Flag == 0 && sTerm.BinCli))
+		return erSUCCESS;								// opened by the client, it also ends it
+	int iRV = xTelnetEndText();							// NUL of a bare CR belongs to the NVT text
+	if (iRV == erSUCCESS)
+		iRV = xTelnetFlush();							// options are sent raw, must follow queued data
+	if (iRV < erSUCCESS)
+		return iRV;
+	if (Flag == 0) {									// WONT cannot be refused, answer not awaited
+		vTelnetSendOption(tnetOPT_BINARY, tnetWONT);
+		sTerm.BinTx = 0;								// DONT acknowledgement ignored when it arrives
+		return (State == tnetSTATE_RUNNING) ? erSUCCESS : erFAILURE;
+	}
+	sTerm.BinReq = 1;
+	vTelnetSendOption(tnetOPT_BINARY, tnetWILL);
+	u32_t DL = xTaskGetTickCount() + pdMS_TO_TICKS(tnetMS_NEGOTIATE);
+	while (sTerm.BinReq && State == tnetSTATE_RUNNING) {
+		if (sTerm.rxhout && sTerm.rxhlen == sizeof(sTerm.rxhold)) {	// compact, make space at the end
+			sTerm.rxhlen -= sTerm.rxhout;
+			memmove(sTerm.rxhold, &sTerm.rxhold[sTerm.rxhout], sTerm.rxhlen);
+			sTerm.rxhout = 0;
+		}
+		if (sTerm.rxhlen == sizeof(sTerm.rxhold)) {
+			vTaskDelay(pdMS_TO_TICKS(tnetMS_READ_WRITE));	// full, leave the rest in the socket
+		} else {
+			u8_t cChr;
+			if (xNetRecv(&sTerm.sCtx, &cChr, 1) == 1) {
+				if (xTelnetParseChar(cChr) != erSUCCESS)
+					sTerm.rxhold[sTerm.rxhlen++] = cChr;
+				continue;
+			}
+			if (sTerm.sCtx.error != EAGAIN) {
+				State = tnetSTATE_DEINIT;
+				break;
+			}
+		}
+		if ((i32_t) (xTaskGetTickCount() - DL) >= 0)
+			break;
+	}
+	sTerm.BinReq = 0;
+	return (State == tnetSTATE_RUNNING && sTerm.BinTx) ? erSUCCESS : erFAILURE;
+}
+
+/**
+ * @brief	check that a binary transfer can be started (telnet task, client connected & running)
+ */
+static bool bTelnetBinaryOK(void) {
+	return (xTaskGetCurrentTaskHandle() == TnetHandle) && (State == tnetSTATE_RUNNING) &&
+			(sTerm.BatRun == 0);						// raw data would break the batch framing
+}
+
+/**
+ * @brief	send the batch output collected so far as a single frame
+ * @param	Status - tnetBATCH_MORE or the (clipped) command result
+ * @return	number of bytes written or (-) error code
+ */
+static ssize_t xTelnetBatchFrame(u8_t Status) {
+	u8_t Hdr[tnetBATCH_HDR] = { tnetBATCH_SOH, sTerm.batid >> 8, sTerm.batid & 0xFF, Status, sTerm.batlen >> 8, sTerm.batlen & 0xFF };
+	ssize_t iRV = xTelnetWriteBinary(Hdr, sizeof(Hdr));	// left in bulk mode, frames packed until idle
+	if (iRV >= 0 && sTerm.batlen)
+		iRV = xTelnetWriteBinary(sTerm.batbuf, sTerm.batlen);
+	sTerm.batlen = 0;
 	return iRV;
 }
 
+/**
+ * @brief	collect batch command output, sending a tnetBATCH_MORE frame each time the buffer fills
+ * @return	Size or (-) error code
+ */
+static ssize_t xTelnetBatchWrite(const void * pVoid, size_t Size) {
+	const u8_t * pSrc = pVoid;
+	size_t Left = Size;
+	while (Left) {
+		if (sTerm.batlen == sizeof(sTerm.batbuf)) {		// only once more follows, last frame has status
+			ssize_t iRV = xTelnetBatchFrame(tnetBATCH_MORE);
+			if (iRV < 0)
+				return iRV;
+		}
+		size_t Len = sizeof(sTerm.batbuf) - sTerm.batlen;
+		if (Len > Left)
+			Len = Left;
+		memcpy(&sTerm.batbuf[sTerm.batlen], pSrc, Len);
+		sTerm.batlen += Len;
+		pSrc += Len;
+		Left -= Len;
+	}
+	return Size;
+}
 
 #if defined(printfxVER0)
 	static int xTelnetPutC(xp_t * psXP, int iChr) { 
@@ -369,12 +1074,124 @@ ssize_t xTelnetWrite(const void * pVoid, size_t Size) {
 		int iRV = xTelnetWrite(&cChr, 1);
 		return (iRV == 1) ? iChr : iRV;
 	}
+	static int xTelnetPutBatchC(xp_t * psXP, int iChr) { 
+		u8_t cChr = iChr;
+		int iRV = xTelnetBatchWrite(&cChr, 1);
+		return (iRV == 1) ? iChr : iRV;
+	}
 #elif defined(printfxVER1)
 	int xTelnetPutBuf(xp_t * psXP, const char * pcSrc, size_t sSrc) {
 		return xTelnetWrite(pcSrc, sSrc);
 	}
+	static int xTelnetPutBatch(xp_t * psXP, const char * pcSrc, size_t sSrc) {
+		return xTelnetBatchWrite(pcSrc, sSrc);
+	}
 #endif
 
+/**
+ * @brief	process a command string as if from the UART console
+ * @param	pCmd - NUL terminated command string
+ * @param	bBatch - 0 = output direct to the client, 1 = collected into batch frames
+ * @return	result of the command processor
+ */
+static int xTelnetExecute(u8_t * pCmd, bool bBatch) {
+	// Ensure UARTx marked inactive so output goes to buffer
+	#if (configCONSOLE_UART > -1 && cmakeWRAP_STDIO == 1)
+		vStdioConsoleSetStatus(0);					// disable output to console, force buffered for Telnet to grab
+	#endif
+	#if defined(printfxVER0)
+		command_t sCmd = { .sRprt={ .hdlr = bBatch ? xTelnetPutBatchC : xTelnetPutC, .bHdlr = 1, .XLock = sNONE, .uSGR = sgrANSI } };
+	#elif defined(printfxVER1)
+		command_t sCmd = { .sRprt={ .hdlr = bBatch ? xTelnetPutBatch : xTelnetPutBuf, .bHdlr = 1, .XLock = sNONE, .uSGR = sgrANSI } };
+	#endif
+	sCmd.pCmd = pCmd;								// Changed in vCommandInterpret()
+	sCmd.Priv = sTerm.auth;
+	sCmd.Src = cmdSRC_TNET;							// syntax errors reported at NOTICE, not ERROR
+	vStdioPushMaxRowYColX(NULL);					// push/save current MaxXY values (UART)
+	vStdioSetMaxRowYColX(NULL, sTerm.RowY, sTerm.ColX);// set new MaxXY values (Telnet)
+	int iRV = xCommandProcess(&sCmd);
+	vStdioPullMaxRowYColX(NULL);					// pull/restore original MaxXY values (UART)
+	return iRV;
+}
+
+/**
+ * @brief	run a completed batch command line and return its output & result framed
+ */
+static void vTelnetBatchRun(void) {
+	char * pcCmd = (char *) sTerm.cmdbuf;
+	int iRV = erSUCCESS;
+	if (sTerm.cmdlen < sizeof(sTerm.cmdbuf)) {
+		sTerm.cmdbuf[sTerm.cmdlen] = CHR_NUL;
+	} else {											// overflowed line is NOT run, truncated is wrong
+		sTerm.cmdbuf[sizeof(sTerm.cmdbuf) - 1] = CHR_NUL;	// but the id is still returned
+		iRV = erFAILURE;
+	}
+	sTerm.batid = strtoul((char *) sTerm.cmdbuf, &pcCmd, 10) & 0xFFFF;
+	if (pcCmd == (char *) sTerm.cmdbuf || *pcCmd != CHR_SPACE)
+		iRV = erFAILURE;								// no numeric id or no SP, NOT run
+	else
+		++pcCmd;
+	sTerm.batlen = 0;
+	sTerm.cmdlen = 0;
+	if (xTelnetSetBinary(1) < erSUCCESS) {				// frames are NOT safe on an NVT stream
+		if (State == tnetSTATE_RUNNING) {
+			char caBuf[32];								// id, client can match it to the line
+			int Len = snprintf(caBuf, sizeof(caBuf), "?Batch %u needs BINARY" strNL, sTerm.batid);
+			xTelnetWrite(caBuf, Len);
+		}
+		return;
+	}
+	if (iRV == erSUCCESS && *pcCmd != CHR_NUL) {
+		sTerm.BatRun = 1;
+		iRV = xTelnetExecute((u8_t *) pcCmd, 1);
+	#if (configCONSOLE_UART > -1 && cmakeWRAP_STDIO == 1)
+		if (xStdOutBufFlush(xTelnetBatchWrite) < erSUCCESS)	// buffered console output is part of the result
+			State = tnetSTATE_DEINIT;
+	#endif
+		sTerm.BatRun = 0;
+	}
+	if (iRV >= tnetBATCH_MORE)
+		iRV = tnetBATCH_MORE - 1;
+	else if (iRV < INT8_MIN)
+		iRV = INT8_MIN;
+	xTelnetBatchFrame((u8_t) iRV);
+}
+
+/**
+ * @brief	collect a batch command line, SOH through CR/LF
+ */
+static void vTelnetBatchChar(u8_t cChr) {
+	if (sTerm.Batch == 0) {								// SOH, start of a new line
+		sTerm.Batch = 1;
+		sTerm.cmdlen = 0;
+	} else if (cChr == CHR_CR || cChr == CHR_LF) {
+		sTerm.Batch = 0;
+		sTerm.BatCR = (cChr == CHR_CR) ? 1 : 0;
+		vTelnetBatchRun();
+	} else if (cChr != CHR_NUL) {						// stray NUL ignored
+		if (sTerm.cmdlen < (sizeof(sTerm.cmdbuf) - 1))
+			sTerm.cmdbuf[sTerm.cmdlen++] = cChr;
+		else
+			sTerm.cmdlen = sizeof(sTerm.cmdbuf);		// mark overflow
+	}
+}
+
+/**
+ * @brief	end of OPTIONS phase, switch to normal comms timeout and start authentication
+ */
+static void vTelnetOptionsDone(void) {
+	if (xNetSetRecvTO(&sTerm.sCtx, tnetMS_READ_WRITE) != erSUCCESS) {
+		State = tnetSTATE_DEINIT;
+		return;
+	}
+	State = tnetSTATE_AUTHEN;
+	SubState = tnetSUBST_CHECK;
+	if (psParam->auth) {								// arm the budget and prompt ONCE, on entry
+		sTerm.authDL = xTaskGetTickCount() + pdMS_TO_TICKS(tnetMS_AUTHEN);
+		xTelnetWrite("User: ", 6);						// via xTelnetWrite so GA is handled
+	}
+}
+
 /**
  * @brief	Main TelNet task
  */
@@ -382,6 +1199,7 @@ static void vTnetTask(void * pvPara) {
 	int iRV = 0;
 	u8_t caChr[2];
 	psParam = (param_tnet_t *) pvPara;
+	vTelnetBucketInit(&sServTB, ServRate);
 	State = tnetSTATE_INIT;
 	halEventUpdateRunTasks(taskTNET_MASK, 1);
 	while (halEventWaitTasksOK(taskTNET_MASK, portMAX_DELAY)) {
@@ -434,16 +1252,34 @@ static void vTnetTask(void * pvPara) {
 				IF_PX(debugTRACK && psParam->track, "[TNET] rx timeout" strNL);
 				break;
 			}
+			int NoDelay = 1;							// interactive, echo must not wait on Nagle/delayed ACK
+			if (setsockopt(sTerm.sCtx.sd, IPPROTO_TCP, TCP_NODELAY, &NoDelay, sizeof(NoDelay)) != 0) {
+				State = tnetSTATE_DEINIT;
+				IF_PX(debugTRACK && psParam->track, "[TNET] nodelay fail (%d)" strNL, errno);
+				break;
+			}
+			vTelnetBucketInit(&sTerm.sTB, SessRate);
 			IF_PX(debugTRACK && psParam->track, "accept ok" strNL);
 			SubState = tnetSUBST_CHECK;
 			sTerm.RowY = TERMINAL_DFLT_Y;
 			sTerm.ColX = TERMINAL_DFLT_X;
+			sTerm.Learn = 1;							// record answers unless primed from the cache
 			State = tnetSTATE_OPTIONS;					// start processing options
 			halEventUpdateStatus(flagTNET_CLNT, 1);
+			iRV = xTelnetCachePrime();
+			if (iRV != 0) {
+				if (iRV > 0) {							// known client, answered up front, skip OPTIONS
+					vTelnetOptionsDone();
+					IF_PX(debugTRACK && psParam->track, "[TNET] cache hit" strNL);
+				}
+				break;
+			}
 			xTelnetSetBaseline();
 			IF_PX(debugTRACK && psParam->track, "[TNET] baseline ok" strNL);
 		}	/* FALLTHRU */ /* no break */
 		case tnetSTATE_OPTIONS: {
+			if (sTerm.txlen)
+				xTelnetDrain(1);						// paced output, not only from the RUNNING idle loop
 			iRV = xNetRecv(&sTerm.sCtx, (u8_t *)caChr, 1);
 			if (iRV != 1) {
 				if (sTerm.sCtx.error != EAGAIN) { // socket closed or error (excl EAGAIN)
@@ -458,17 +1294,11 @@ static void vTnetTask(void * pvPara) {
 				/* still in OPTIONS, read a character, was NOT parsed as a valid OPTION char, then HWHAP !!! */
 				IF_myASSERT(debugTRACK && SubState != tnetSUBST_CHECK, 0);
 			}
-			// setup timeout for processing normal comms
-			if ((iRV = xNetSetRecvTO(&sTerm.sCtx, tnetMS_READ_WRITE)) != erSUCCESS) {
-				State = tnetSTATE_DEINIT;
-				break;
-			}
-			State = tnetSTATE_AUTHEN; // no char, start authenticate
-			SubState = tnetSUBST_CHECK;
-			if (psParam->auth) {						// arm the budget and prompt ONCE, on entry
-				sTerm.authDL = xTaskGetTickCount() + pdMS_TO_TICKS(tnetMS_AUTHEN);
-				xTelnetWrite("User: ", 6);				// via xTelnetWrite so GA is handled
+			if (sTerm.Learn) {							// no char, options agreed, remember for next time
+				vTelnetCacheStore();
+				sTerm.Learn = 0;
 			}
+			vTelnetOptionsDone();						// start authenticate
 			IF_PX(debugTRACK && psParam->track, "[TNET] options ok" strNL);
 			break;										// AUTHEN no longer blocks, re-enter cleanly
 		}
@@ -481,6 +1311,8 @@ static void vTnetTask(void * pvPara) {
 				State = tnetSTATE_RUNNING;
 				break;
 			}
+			if (sTerm.txlen)
+				xTelnetDrain(1);						// prompt may be held by the rate limit(s)
 			iRV = xNetRecv(&sTerm.sCtx, caChr, 1);
 			if (iRV != 1) {
 				if (sTerm.sCtx.error != EAGAIN) {		// socket closed or error
@@ -518,56 +1350,64 @@ static void vTnetTask(void * pvPara) {
 			} else if (caChr[0] == CHR_BS) {			// correct typo
 				if (sTerm.authlen > 0) {
 					--sTerm.authlen;
-					xNetSend(&sTerm.sCtx, (u8_t *) cAuthBS, sizeof(cAuthBS));
+					xTelnetEcho(cAuthBS, sizeof(cAuthBS));
 				}
 			} else if (sTerm.authlen < (sizeof(sTerm.authbuf) - 1) && INRANGE(CHR_SPACE, caChr[0], CHR_TILDE)) {
 				sTerm.authbuf[sTerm.authlen++] = caChr[0];
 				u8_t cEcho = (sTerm.apswd && psParam->echo == 0) ? CHR_ASTERISK : caChr[0];
-				xNetSend(&sTerm.sCtx, &cEcho, 1);		// raw: per character GA would be noise
+				xTelnetEcho(&cEcho, 1);
 			}
 			break;
 		}
 		case tnetSTATE_RUNNING: {
+			if (sTerm.rxhout < sTerm.rxhlen) {			// Step 0: data held while negotiating, parsed already
+				caChr[0] = sTerm.rxhold[sTerm.rxhout++];
+				if (sTerm.rxhout == sTerm.rxhlen)
+					sTerm.rxhout = sTerm.rxhlen = 0;
+				goto data;
+			}
 			iRV = xNetRecv(&sTerm.sCtx, caChr, 1);		// Step 1: read a single character
 			if (iRV != 1) {
 				if (sTerm.sCtx.error != EAGAIN) {		// socket closed or error (but not EAGAIN)
 					State = tnetSTATE_DEINIT;
 					IF_PX(debugTRACK && psParam->track, "[TNET] read fail (%d)" strNL, sTerm.sCtx.error);
 				} else {
+					if (sTerm.BinTx && sTerm.txlen == 0)	// batch done & sent, back to NVT for console text
+						xTelnetSetBinary(0);				// paced frames still queued drain first, below
 				#if (configCONSOLE_UART > -1 && cmakeWRAP_STDIO == 1)
-					iRV = xStdOutBufFlush(xTelnetWrite); // flush any buffered output
-					if (iRV < erSUCCESS)
-						State = tnetSTATE_DEINIT;
+					if (sTerm.BinTx == 0 || sTerm.BinCli) {	// else text waits until binary is dropped
+						iRV = xStdOutBufFlush(xTelnetWrite); // flush any buffered output
+						if (iRV < erSUCCESS)
+							State = tnetSTATE_DEINIT;
+					}
 				#endif
+					vTelnetEndBurst();						// idle, uncork whatever is left
 				}
 				break;
 			}
 			// Step 2: check if not part of Telnet negotiation
 			if (xTelnetParseChar(caChr[0]) == erSUCCESS)
 				break;
+		data:
 			// Step 3: Handle special (non-Telnet) characters
 			if (caChr[0] == CHR_GS) {					// cntl + ']'
 				State = tnetSTATE_DEINIT;
 				break;
 			}
-			// Step 4: Ensure UARTx marked inactive so output goes to buffer
-			#if (configCONSOLE_UART > -1 && cmakeWRAP_STDIO == 1)
-				vStdioConsoleSetStatus(0);				// disable output to console, force buffered for Telnet to grab
-			#endif
+			// Step 4: batch command line, collected then run with framed output, uncorked when idle
+			if (sTerm.BatCR) {							// LF/NUL of CR LF or CR NUL ending a batch line
+				sTerm.BatCR = 0;
+				if (caChr[0] == CHR_LF || caChr[0] == CHR_NUL)
+					break;
+			}
+			if (sTerm.Batch || caChr[0] == tnetBATCH_SOH) {
+				vTelnetBatchChar(caChr[0]);
+				break;
+			}
 			// Step 5: must be a normal command character, process as if from UART console....
-			#if defined(printfxVER0)
-				command_t sCmd = { .sRprt={ .hdlr = xTelnetPutC, .bHdlr = 1, .XLock = sNONE, .uSGR = sgrANSI } };
-			#elif defined(printfxVER1)
-				command_t sCmd = { .sRprt={ .hdlr = xTelnetPutBuf, .bHdlr = 1, .XLock = sNONE, .uSGR = sgrANSI } };
-			#endif
 			caChr[1] = CHR_NUL;							// ensure NULL terminated
-			sCmd.pCmd = caChr;							// Changed in vCommandInterpret()
-			sCmd.Priv = sTerm.auth;
-			sCmd.Src = cmdSRC_TNET;					// syntax errors reported at NOTICE, not ERROR
-			vStdioPushMaxRowYColX(NULL);				// push/save current MaxXY values (UART)
-			vStdioSetMaxRowYColX(NULL, sTerm.RowY, sTerm.ColX);// set new MaxXY values (Telnet)
-			xCommandProcess(&sCmd);
-			vStdioPullMaxRowYColX(NULL);				// pull/restore original MaxXY values (UART)
+			xTelnetExecute(caChr, 0);
+			vTelnetEndBurst();							// command done, uncork & back to interactive
 			break;
 		}
 		default: IF_myASSERT(debugTRACK, 0);
@@ -591,17 +1431,160 @@ void vTnetStart(void * pvPara) {
 	TnetHandle = xTaskCreateWithMask(&sTnetCfg, pvPara);
 }
 
+/**
+ * @brief	reference NVT encoder, byte at a time, destination must be 2x source size
+ */
+static size_t xTelnetEncodeByte(u8_t * pDst, const u8_t * pSrc, size_t sSrc, bool bText, bool * pbCR) {
+	u8_t * pD = pDst;
+	for (size_t idx = 0; idx < sSrc; ++idx) {
+		u8_t cChr = pSrc[idx];
+		if (bText && *pbCR) {
+			*pbCR = 0;
+			if (cChr == CHR_LF) {
+				*pD++ = cChr;
+				continue;
+			}
+			*pD++ = CHR_NUL;
+		}
+		if (cChr == tnetIAC)
+			*pD++ = tnetIAC;
+		else if (bText && cChr == CHR_CR)
+			*pbCR = 1;
+		else if (bText && cChr == CHR_LF)
+			*pD++ = CHR_CR;
+		*pD++ = cChr;
+	}
+	return pD - pDst;
+}
+
+/**
+ * @brief	encode in pseudo random pieces, 1-7 source bytes into 2-9 byte destination windows,
+ *			to exercise the CR carry, IAC at a full window and window limited scans
+ */
+static size_t xTelnetEncodeSplit(u8_t * pDst, const u8_t * pSrc, size_t sSrc, bool bText, bool * pbCR, u32_t * pSeed) {
+	size_t In = 0, Out = 0;
+	while (In < sSrc) {
+		*pSeed = *pSeed * 1103515245UL + 12345UL;
+		size_t Used = 1 + ((*pSeed >> 16) % 7);
+		size_t Room = 2 + ((*pSeed >> 8) % 8);
+		if (Used > (sSrc - In))
+			Used = sSrc - In;
+		Out += xTelnetEncode(pDst + Out, Room, pSrc + In, &Used, bText, pbCR);
+		In += Used;
+	}
+	return Out;
+}
+
+void vTnetBenchEncoder(report_t * psR) {
+	u8_t * pSrc = malloc(tnetBENCH_SIZE * 7);
+	if (pSrc == NULL)
+		return;
+	u8_t * pDst1 = pSrc + tnetBENCH_SIZE;
+	u8_t * pDst2 = pDst1 + (tnetBENCH_SIZE * 2);
+	u8_t * pDst3 = pDst2 + (tnetBENCH_SIZE * 2);
+	const char * const Name[3] = { "clean", "mixed", "binary" };
+	u32_t Seed = 1;
+	for (int Pass = 0; Pass < 3; ++Pass) {				// clean text, text with binary bytes, binary
+		bool bText = (Pass < 2);
+		for (int idx = 0; idx < tnetBENCH_SIZE; ++idx)
+			pSrc[idx] = Pass ? (idx * 167 + 13) & 0xFF :
+						(idx % 64 == 62) ? CHR_CR : (idx % 64 == 63) ? CHR_LF : 'a' + (idx % 26);
+		size_t Len1 = 0, Len2 = 0;
+		bool bCR1 = 0, bCR2 = 0;
+		i64_t T0 = esp_timer_get_time();
+		for (int Loop = 0; Loop < tnetBENCH_LOOPS; ++Loop) {
+			size_t Used = tnetBENCH_SIZE;
+			bCR1 = 0;
+			Len1 = xTelnetEncode(pDst1, tnetBENCH_SIZE * 2, pSrc, &Used, bText, &bCR1);
+		}
+		i64_t T1 = esp_timer_get_time();
+		for (int Loop = 0; Loop < tnetBENCH_LOOPS; ++Loop) {
+			bCR2 = 0;
+			Len2 = xTelnetEncodeByte(pDst2, pSrc, tnetBENCH_SIZE, bText, &bCR2);
+		}
+		i64_t T2 = esp_timer_get_time();
+		bool bWhole = (Len1 == Len2) && (bCR1 == bCR2) && (memcmp(pDst1, pDst2, Len1) == 0);
+		bool bSplit = 1;
+		for (int Loop = 0; Loop < tnetBENCH_LOOPS && bSplit; ++Loop) {
+			bool bCR3 = 0;
+			size_t Len3 = xTelnetEncodeSplit(pDst3, pSrc, tnetBENCH_SIZE, bText, &bCR3, &Seed);
+			bSplit = (Len3 == Len2) && (bCR3 == bCR2) && (memcmp(pDst3, pDst2, Len3) == 0);
+		}
+		xReport(psR, "\tNVT %s %dx%d  word=%uuS  byte=%uuS  out=%u  whole=%s  split=%s" strNL, Name[Pass],
+				tnetBENCH_LOOPS, tnetBENCH_SIZE, (u32_t) (T1 - T0), (u32_t) (T2 - T1), Len1,
+				bWhole ? "OK" : "MISMATCH", bSplit ? "OK" : "MISMATCH");
+	}
+	free(pSrc);
+}
+
+ssize_t xTnetSendMemory(const void * pvSrc, size_t Size) {
+	if (bTelnetBinaryOK() == 0)
+		return erFAILURE;
+	ssize_t iRV = xTelnetSetBinary(1);
+	if (iRV < erSUCCESS)
+		return iRV;
+	iRV = xTelnetWriteBinary(pvSrc, Size);
+	if (xTelnetSetBinary(0) < erSUCCESS && iRV >= 0)
+		iRV = erFAILURE;
+	return iRV;
+}
+
+ssize_t xTnetSendFile(const char * pcName) {
+	if (bTelnetBinaryOK() == 0)
+		return erFAILURE;
+	FILE * fp = fopen(pcName, "rb");
+	if (fp == NULL)
+		return erFAILURE;
+	ssize_t iRV = erFAILURE;
+	ssize_t Total = 0;
+	u8_t * pBuf = malloc(tnetBIN_CHUNK);
+	if (pBuf == NULL)
+		goto exit;
+	iRV = xTelnetSetBinary(1);
+	if (iRV < erSUCCESS)
+		goto exit;
+	size_t Len;
+	while ((Len = fread(pBuf, 1, tnetBIN_CHUNK, fp)) > 0) {
+		iRV = xTelnetWriteBinary(pBuf, Len);
+		if (iRV < 0)
+			break;
+		Total += iRV;
+	}
+	if (iRV >= 0 && ferror(fp))
+		iRV = erFAILURE;
+	if (xTelnetSetBinary(0) < erSUCCESS && iRV >= 0)
+		iRV = erFAILURE;
+	if (iRV >= 0)
+		iRV = Total;
+exit:
+	free(pBuf);
+	fclose(fp);
+	return iRV;
+}
+
+void vTnetSetRate(u32_t Session, u32_t Server) {
+	SessRate = Session;
+	ServRate = Server;
+	vTelnetBucketInit(&sServTB, ServRate);
+	if (halEventCheckStatus(flagTNET_CLNT))
+		vTelnetBucketInit(&sTerm.sTB, SessRate);
+}
+
 void vTnetReport(report_t *psR) {
 	if (halEventCheckStatus(flagTNET_SERV)) {
 		xNetReport(psR, &sServTNetCtx, "TNET_S", 0, 0, 0);
 		xReport(psR, "\tFSM=%d  [maxTX=%u  maxRX=%u] [MaxX=%hu  MaxY=%hu]" strNL, State,
 						sServTNetCtx.maxTx, sServTNetCtx.maxRx, sTerm.ColX, sTerm.RowY);
+		xReport(psR, "\tRate=%u B/s  Tokens=%u/%u  Cache hit=%u miss=%u" strNL, sServTB.Rate, sServTB.Tokens,
+						sServTB.Burst, CacheHit, CacheMiss);
 	}
 	if (halEventCheckStatus(flagTNET_CLNT)) {
 		xNetReport(psR, &sTerm.sCtx, "TNET_C", 0, 0, 0);
+		xReport(psR, "\tRate=%u B/s  Tokens=%u/%u  TxQ=%hu" strNL, sTerm.sTB.Rate, sTerm.sTB.Tokens,
+						sTerm.sTB.Burst, sTerm.txlen - sTerm.txout);
 		if (debugTRACK && psParam->track) {
 			xReport(psR, "%CTNET_O%C\t", xpfCOL(colourFG_CYAN,0), xpfCOL(attrRESET,0));
-			for (int idx = tnetOPT_ECHO; idx < tnetOPT_MAX_VAL; ++idx) {
+			for (int idx = tnetOPT_BINARY; idx < tnetOPT_MAX_VAL; ++idx) {
 				if (idx == 17 || idx == 33)
 					xReport(psR, strNL "\t");
 				xReport(psR, "%d/%s=%s ", idx, xTelnetFindName(idx), codename[xTelnetGetOption(idx)]);
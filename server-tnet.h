@@ -33,6 +33,7 @@ enum tnetCMD {
 } ;
 
 enum tnetOPT {
+	tnetOPT_BINARY		= 0,		// https://tools.ietf.org/pdf/rfc856.pdf
 	tnetOPT_ECHO		= 1,		// https://tools.ietf.org/pdf/rfc857.pdf
 	tnetOPT_SGA			= 3,		// https://tools.ietf.org/pdf/rfc858.pdf
 	tnetOPT_TTYPE		= 24,
@@ -88,6 +89,42 @@ void vTnetStart(void * pvPara);
 
 void vTnetReport(report_t * psR);
 
+/**
+ * @brief		set transmit rate limits, applied immediately
+ * @param[in]	Session - bytes/sec per session, 0 = unlimited
+ * @param[in]	Server - bytes/sec all sessions combined, 0 = unlimited
+ * @note		output held back is queued (tnetTX_QUEUE bytes, default 3 x MSS) and paced from the
+ *				idle loop. A command producing more than that while limited WAITS for the queue to
+ *				drain, and Ctrl-] is only seen once it completes. Size tnetTX_QUEUE accordingly.
+ */
+void vTnetSetRate(u32_t Session, u32_t Server);
+
+/**
+ * @brief		NVT encoder self test & benchmark: word at a time vs byte at a time reference, whole
+ *				buffer and split into random pieces (CR carry, IAC at a full window)
+ * @param[in]	psR - report destination
+ */
+void vTnetBenchEncoder(report_t * psR);
+
+/**
+ * @brief		stream a memory region to the telnet client in TRANSMIT-BINARY mode
+ * @param[in]	pvSrc - start address of the region
+ * @param[in]	Size - number of bytes to send
+ * @return		number of (unescaped) bytes sent or (-) error code
+ * @note		only valid from a command executing in the telnet task, end of data is
+ *				marked by IAC WONT BINARY
+ */
+ssize_t xTnetSendMemory(const void * pvSrc, size_t Size);
+
+/**
+ * @brief		stream a file to the telnet client in TRANSMIT-BINARY mode
+ * @param[in]	pcName - full path of the file
+ * @return		number of (unescaped) bytes sent or (-) error code
+ * @note		only valid from a command executing in the telnet task, end of data is
+ *				marked by IAC WONT BINARY
+ */
+ssize_t xTnetSendFile(const char * pcName);
+
 #ifdef __cplusplus
 }
 #endif